@@ -0,0 +1,476 @@
+/*
+    File: allocbench.c
+
+    Benchmark for my_allocator, against the system malloc.
+
+    Every workload is a fixed sequence of allocate/free operations (the
+    same seed gives the same sequence), which is run once against
+    my_allocator and once against malloc/free. Each run happens in a
+    child process of its own, so the peak footprint reported for it
+    (the growth of its resident set) is not polluted by the other runs.
+
+    Workloads:
+      ackerman  -- the recursion of ackerman.c, with its allocation sizes
+      uniform   -- random alloc/free, sizes uniform in [16, 4096]
+      powerlaw  -- random alloc/free, sizes from a power law (many small,
+                   a few very large)
+      bursty    -- allocate a burst of small blocks, then free them all
+      trace     -- replay a trace file (see -f)
+
+    Trace files have one operation per line:
+      a <id> <size>    allocate <size> bytes and call the block <id>
+      f <id>           free the block <id>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "my_allocator.h"
+
+/*--------------------------------------------------------------------------*/
+/* DATA STRUCTURES */
+/*--------------------------------------------------------------------------*/
+
+/* One operation of a workload. */
+typedef struct Op {
+  unsigned int id;   /* which block */
+  unsigned int size; /* 0 for a free */
+} Op;
+
+typedef struct Workload {
+  const char* name;
+  Op* ops;
+  unsigned int nops;
+  unsigned int nids;
+} Workload;
+
+/* What a run sends back to the parent. */
+typedef struct RunResult {
+  double seconds;
+  unsigned long ops;
+  unsigned long failed;
+  unsigned long p50, p99, p999, max; /* nanoseconds */
+  long rss_before;                   /* kB */
+  unsigned long high_water;          /* bytes, my_allocator only */
+} RunResult;
+
+/*--------------------------------------------------------------------------*/
+/* CONSTANTS, INITIAL VALUES */
+/*--------------------------------------------------------------------------*/
+
+unsigned int basic_block_size = 128;
+unsigned int memory_length = 64 * 1024 * 1024;
+unsigned int nops = 2000000;
+unsigned int live_blocks = 1000;
+unsigned int seed = 313;
+int ack_n = 3, ack_m = 6;
+const char* trace_file = NULL;
+const char* record_prefix = NULL;
+
+/* every SAMPLE_EVERY-th operation is timed */
+#define SAMPLE_EVERY 8
+
+/*--------------------------------------------------------------------------*/
+/* ALLOCATORS UNDER TEST */
+/*--------------------------------------------------------------------------*/
+
+typedef struct AllocatorUnderTest {
+  const char* name;
+  void* (*alloc)(unsigned int);
+  void (*release)(void*);
+} AllocatorUnderTest;
+
+Allocator* arena;
+
+void* arena_alloc(unsigned int size) { return allocator_malloc(arena, size); }
+void arena_release(void* p) { allocator_free(arena, p); }
+void* libc_alloc(unsigned int size) { return malloc(size); }
+void libc_release(void* p) { free(p); }
+
+AllocatorUnderTest allocators[] = {
+  { "my_allocator", arena_alloc, arena_release },
+  { "malloc", libc_alloc, libc_release },
+};
+
+/*--------------------------------------------------------------------------*/
+/* LATENCY HISTOGRAM */
+/*--------------------------------------------------------------------------*/
+
+/* Log-linear buckets: 8 buckets for every power of 2, about 12% precision. */
+#define SUB_BUCKETS 8
+#define LATENCY_BUCKETS (64 * SUB_BUCKETS)
+
+unsigned long latency[LATENCY_BUCKETS];
+
+unsigned int latency_bucket(unsigned long ns) {
+  if (ns < SUB_BUCKETS)
+    return ns;
+  unsigned int log = 63 - __builtin_clzl(ns);
+  unsigned int sub = (ns >> (log - 3)) & (SUB_BUCKETS - 1);
+  return (log - 2) * SUB_BUCKETS + sub;
+}
+
+unsigned long bucket_value(unsigned int bucket) {
+  if (bucket < SUB_BUCKETS)
+    return bucket;
+  unsigned int log = bucket / SUB_BUCKETS + 2;
+  unsigned int sub = bucket % SUB_BUCKETS;
+  return (1ul << log) + ((unsigned long)sub << (log - 3));
+}
+
+unsigned long latency_percentile(double fraction) {
+  unsigned long total = 0, seen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++)
+    total += latency[i];
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += latency[i];
+    if (total > 0 && seen >= fraction * total)
+      return bucket_value(i);
+  }
+  return 0;
+}
+
+unsigned long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+long current_rss_kb() {
+  long pages = 0, resident = 0;
+  FILE* f = fopen("/proc/self/statm", "r");
+  if (f != NULL) {
+    if (fscanf(f, "%ld %ld", &pages, &resident) != 2)
+      resident = 0;
+    fclose(f);
+  }
+  return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/*--------------------------------------------------------------------------*/
+/* WORKLOAD GENERATION */
+/*--------------------------------------------------------------------------*/
+
+void add_op(Workload* w, unsigned int id, unsigned int size) {
+  if (w->nops % 65536 == 0)
+    w->ops = (Op*)realloc(w->ops, (w->nops + 65536) * sizeof(Op));
+  w->ops[w->nops].id = id;
+  w->ops[w->nops].size = size;
+  w->nops++;
+  if (id >= w->nids)
+    w->nids = id + 1;
+}
+
+double uniform01(unsigned int* state) {
+  return (rand_r(state) + 1.0) / (RAND_MAX + 2.0);
+}
+
+/* Random alloc/free over 'live_blocks' slots, sizes drawn by 'size_of'. */
+void make_random(Workload* w, unsigned int (*size_of)(unsigned int*)) {
+  unsigned int state = seed;
+  char* live = (char*)calloc(live_blocks, 1);
+  for (unsigned int i = 0; i < nops; i++) {
+    unsigned int slot = rand_r(&state) % live_blocks;
+    add_op(w, slot, live[slot] ? 0 : size_of(&state));
+    live[slot] = !live[slot];
+  }
+  for (unsigned int slot = 0; slot < live_blocks; slot++) {
+    if (live[slot])
+      add_op(w, slot, 0);
+  }
+  free(live);
+}
+
+unsigned int uniform_size(unsigned int* state) {
+  return 16 + rand_r(state) % (4096 - 16 + 1);
+}
+
+unsigned int powerlaw_size(unsigned int* state) {
+  /* Pareto with alpha 1.2 and minimum 16 bytes, capped at 1MB */
+  double size = 16.0 / pow(uniform01(state), 1.0 / 1.2);
+  return (size > 1048576.0) ? 1048576 : (unsigned int)size;
+}
+
+void make_bursty(Workload* w) {
+  unsigned int state = seed;
+  while (w->nops < nops) {
+    unsigned int burst = 1 + rand_r(&state) % live_blocks;
+    for (unsigned int id = 0; id < burst; id++)
+      add_op(w, id, 16 + rand_r(&state) % 512);
+    /* free in a shuffled order, so coalescing gets some work */
+    for (unsigned int i = 0; i < burst; i++) {
+      unsigned int j = i + rand_r(&state) % (burst - i);
+      Op tmp = w->ops[w->nops - burst + i];
+      w->ops[w->nops - burst + i] = w->ops[w->nops - burst + j];
+      w->ops[w->nops - burst + j] = tmp;
+    }
+    unsigned int end = w->nops;
+    for (unsigned int i = end - burst; i < end; i++)
+      add_op(w, w->ops[i].id, 0);
+  }
+}
+
+/* The recursion of ackerman.c: every call allocates, recurses and frees. */
+int ackerman_ops(Workload* w, int a, int b, unsigned int* state, unsigned int depth) {
+  unsigned int to_alloc = ((2 << (rand_r(state) % 19)) * (rand_r(state) % 100)) / 100;
+  if (to_alloc < 4)
+    to_alloc = 4;
+  int result;
+  add_op(w, depth, to_alloc);
+  if (a == 0)
+    result = b + 1;
+  else if (b == 0)
+    result = ackerman_ops(w, a - 1, 1, state, depth + 1);
+  else
+    result = ackerman_ops(w, a - 1, ackerman_ops(w, a, b - 1, state, depth + 1), state, depth + 1);
+  add_op(w, depth, 0);
+  return result;
+}
+
+void make_ackerman(Workload* w) {
+  unsigned int state = seed;
+  ackerman_ops(w, ack_n, ack_m, &state, 0);
+}
+
+int load_trace(Workload* w, const char* path) {
+  FILE* f = fopen(path, "r");
+  if (f == NULL) {
+    perror(path);
+    return -1;
+  }
+  char kind;
+  unsigned int id, size;
+  while (fscanf(f, " %c %u", &kind, &id) == 2) {
+    if (kind == 'a') {
+      if (fscanf(f, "%u", &size) != 1 || size == 0)
+        break;
+      add_op(w, id, size);
+    }
+    else
+      add_op(w, id, 0);
+  }
+  fclose(f);
+  return 0;
+}
+
+void record_trace(Workload* w) {
+  char path[1024];
+  snprintf(path, sizeof(path), "%s.%s.trace", record_prefix, w->name);
+  FILE* f = fopen(path, "w");
+  if (f == NULL) {
+    perror(path);
+    return;
+  }
+  for (unsigned int i = 0; i < w->nops; i++) {
+    if (w->ops[i].size != 0)
+      fprintf(f, "a %u %u\n", w->ops[i].id, w->ops[i].size);
+    else
+      fprintf(f, "f %u\n", w->ops[i].id);
+  }
+  fclose(f);
+}
+
+/*--------------------------------------------------------------------------*/
+/* RUNNING A WORKLOAD */
+/*--------------------------------------------------------------------------*/
+
+/* Runs the workload in the calling (child) process. */
+RunResult run(Workload* w, AllocatorUnderTest* at) {
+  RunResult result;
+  memset(&result, 0, sizeof(result));
+  memset(latency, 0, sizeof(latency));
+  void** blocks = (void**)calloc(w->nids, sizeof(void*));
+
+  if (at->alloc == arena_alloc)
+    arena = allocator_create(basic_block_size, memory_length, ALLOCATOR_GROWABLE);
+  result.rss_before = current_rss_kb();
+
+  unsigned long start = now_ns();
+  for (unsigned int i = 0; i < w->nops; i++) {
+    Op* op = &w->ops[i];
+    unsigned long t0 = (i % SAMPLE_EVERY == 0) ? now_ns() : 0;
+    if (op->size != 0) {
+      char* p = (char*)at->alloc(op->size);
+      if (p != NULL)
+        p[0] = p[op->size - 1] = 1; /* touch it, like a real user would */
+      else
+        result.failed++;
+      blocks[op->id] = p;
+    }
+    else if (blocks[op->id] != NULL) {
+      at->release(blocks[op->id]);
+      blocks[op->id] = NULL;
+    }
+    if (t0 != 0) {
+      unsigned long ns = now_ns() - t0;
+      latency[latency_bucket(ns)]++;
+      if (ns > result.max)
+        result.max = ns;
+    }
+  }
+  result.seconds = (now_ns() - start) / 1e9;
+  result.ops = w->nops;
+  result.p50 = latency_percentile(0.5);
+  result.p99 = latency_percentile(0.99);
+  result.p999 = latency_percentile(0.999);
+
+  if (arena != NULL) {
+    AllocatorStats stats;
+    allocator_get_stats(arena, &stats);
+    result.high_water = stats.highWater;
+  }
+  return result;
+}
+
+/* Runs the workload in a child process, and prints one line of results. */
+void run_in_child(Workload* w, AllocatorUnderTest* at) {
+  int fds[2];
+  if (pipe(fds) < 0) {
+    perror("pipe");
+    exit(1);
+  }
+
+  pid_t child = fork();
+  if (child < 0) {
+    perror("fork");
+    exit(1);
+  }
+  if (child == 0) {
+    close(fds[0]);
+    RunResult result = run(w, at);
+    if (write(fds[1], &result, sizeof(result)) != sizeof(result))
+      _exit(1);
+    _exit(0);
+  }
+
+  close(fds[1]);
+  RunResult result;
+  ssize_t got = read(fds[0], &result, sizeof(result));
+  close(fds[0]);
+  int status;
+  struct rusage usage;
+  wait4(child, &status, 0, &usage);
+  if (got != sizeof(result) || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    printf("%-10s %-13s run failed\n", w->name, at->name);
+    return;
+  }
+
+  char high_water[32] = "-";
+  if (result.high_water != 0)
+    snprintf(high_water, sizeof(high_water), "%lu", result.high_water / 1024);
+  printf("%-10s %-13s %10.0f %8lu %8lu %8lu %9lu %10ld %10s %8lu\n",
+         w->name, at->name, result.ops / result.seconds,
+         result.p50, result.p99, result.p999, result.max,
+         usage.ru_maxrss - result.rss_before, high_water, result.failed);
+  fflush(stdout);
+}
+
+/*--------------------------------------------------------------------------*/
+/* MAIN FUNCTION */
+/*--------------------------------------------------------------------------*/
+
+void usage() {
+  printf("usage: allocbench [-b <basic block size>] [-s <memory length>] [-n <operations>]\n"
+         "                  [-l <live blocks>] [-r <seed>] [-a <n>,<m>] [-f <trace file>]\n"
+         "                  [-R <prefix>] [workload ...]\n"
+         "  workloads are ackerman, uniform, powerlaw, bursty and trace (needs -f);\n"
+         "  without any, all but trace are run.\n"
+         "  -a sets the ackerman parameters (default 3,6).\n"
+         "  -R writes each workload to <prefix>.<workload>.trace before running it.\n"
+         "  Columns: operations/sec, sampled latency percentiles and max in ns,\n"
+         "  peak resident growth in kB, allocator high-water mark in kB, failed allocations.\n");
+}
+
+int main(int argc, char ** argv) {
+
+  int c;
+  while ((c = getopt(argc, argv, "hb:s:n:l:r:a:f:R:")) != -1) {
+    switch (c) {
+      case 'b':
+        basic_block_size = atoi(optarg);
+        break;
+      case 's':
+        memory_length = atoi(optarg);
+        break;
+      case 'n':
+        nops = atoi(optarg);
+        break;
+      case 'l':
+        live_blocks = atoi(optarg);
+        break;
+      case 'r':
+        seed = atoi(optarg);
+        break;
+      case 'a':
+        if (sscanf(optarg, "%d,%d", &ack_n, &ack_m) != 2) {
+          fprintf(stderr, "Error: -a takes <n>,<m>\n");
+          return -1;
+        }
+        break;
+      case 'f':
+        trace_file = optarg;
+        break;
+      case 'R':
+        record_prefix = optarg;
+        break;
+      case 'h':
+        usage();
+        return 0;
+      default:
+        fprintf(stderr, "Error: unknown flag(s), type -h for help\n");
+        return -1;
+    }
+  }
+  if (live_blocks == 0)
+    live_blocks = 1;
+
+  const char* all[] = { "ackerman", "uniform", "powerlaw", "bursty" };
+  const char** names = all;
+  int nnames = 4;
+  if (optind < argc) {
+    names = (const char**)(argv + optind);
+    nnames = argc - optind;
+  }
+
+  printf("%-10s %-13s %10s %8s %8s %8s %9s %10s %10s %8s\n", "workload", "allocator",
+         "ops/sec", "p50", "p99", "p99.9", "max", "peak kB", "hwm kB", "failed");
+
+  for (int i = 0; i < nnames; i++) {
+    Workload w;
+    memset(&w, 0, sizeof(w));
+    w.name = names[i];
+
+    if (strcmp(w.name, "ackerman") == 0)
+      make_ackerman(&w);
+    else if (strcmp(w.name, "uniform") == 0)
+      make_random(&w, uniform_size);
+    else if (strcmp(w.name, "powerlaw") == 0)
+      make_random(&w, powerlaw_size);
+    else if (strcmp(w.name, "bursty") == 0)
+      make_bursty(&w);
+    else if (strcmp(w.name, "trace") == 0) {
+      if (trace_file == NULL || load_trace(&w, trace_file) < 0) {
+        fprintf(stderr, "Error: the trace workload needs a readable -f <trace file>\n");
+        return -1;
+      }
+    }
+    else {
+      fprintf(stderr, "Error: unknown workload '%s', type -h for help\n", w.name);
+      return -1;
+    }
+
+    if (record_prefix != NULL)
+      record_trace(&w);
+    for (unsigned int j = 0; j < sizeof(allocators) / sizeof(allocators[0]); j++)
+      run_in_child(&w, &allocators[j]);
+    free(w.ops);
+  }
+  return 0;
+}
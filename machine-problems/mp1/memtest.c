@@ -1,12 +1,92 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
 #include "ackerman.h"
+#include "my_allocator.h"
+
+/* keeps the statistics thread from printing while the allocator goes away */
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void release_at_exit() {
+  pthread_mutex_lock(&stats_lock);
+  release_allocator();
+  pthread_mutex_unlock(&stats_lock);
+}
+
+void print_stats_at_exit() {
+  print_allocator_stats();
+}
+
+/* prints the allocator statistics every 'seconds' seconds, while ackerman runs */
+void* stats_routine(void* seconds) {
+  for (;;) {
+    sleep(*(unsigned int*)seconds);
+    pthread_mutex_lock(&stats_lock);
+    print_allocator_stats();
+    pthread_mutex_unlock(&stats_lock);
+  }
+  return NULL;
+}
 
 int main(int argc, char ** argv) {
 
   // input parameters (basic block size, memory length)
+  unsigned int basic_block_size = 128;
+  unsigned int memory_length = 512 * 1024;
+  int stats_at_exit = 0;
+  unsigned int stats_period = 0;
+  unsigned int latency_sampling = 0;
+
+  int c;
+  while ((c = getopt(argc, argv, "hb:s:Sp:l:")) != -1) {
+    switch (c) {
+      case 'b':
+        basic_block_size = atoi(optarg);
+        break;
+      case 's':
+        memory_length = atoi(optarg);
+        break;
+      case 'S':
+        stats_at_exit = 1;
+        break;
+      case 'p':
+        stats_period = atoi(optarg);
+        break;
+      case 'l':
+        latency_sampling = atoi(optarg);
+        break;
+      case 'h':
+        printf("usage: memtest [-b <basic block size>] [-s <memory length>]\n"
+               "               [-S] [-p <seconds>] [-l <n>]\n"
+               "  defaults are 128 bytes and 512kB.\n"
+               "  -S prints the allocator statistics at exit, -p every <seconds> seconds.\n"
+               "  -l measures the latency of every <n>-th allocation and free.\n");
+        return 0;
+      default:
+        fprintf(stderr, "Error: unknown flag(s), type -h for help\n");
+        return -1;
+    }
+  }
 
   // init_allocator(basic block size, memory length)
+  if (init_allocator(basic_block_size, memory_length) == 0) {
+    fprintf(stderr, "Error: cannot initialize allocator with block size %u and length %u\n",
+            basic_block_size, memory_length);
+    return -1;
+  }
+  atexit(release_at_exit);
+  if (stats_at_exit)
+    atexit(print_stats_at_exit); /* runs before release_at_exit */
+  sample_allocator_latency(latency_sampling);
+
+  pthread_t stats_thread;
+  if (stats_period > 0)
+    pthread_create(&stats_thread, NULL, stats_routine, &stats_period);
 
   ackerman_main();
 
-  // release_allocator()
+  // release_allocator() is called by atexit
+  return 0;
 }
@@ -0,0 +1,150 @@
+/*
+    File: mtmemtest.c
+
+    Multithreaded stress test for the thread-safe mode of my_allocator.
+
+    Every thread keeps a set of live blocks, and randomly allocates, fills,
+    checks and frees them. The test is run with 1, 2, 4, ... up to the
+    requested number of threads, and prints the allocation throughput of
+    each run, so the scaling can be read off directly.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "my_allocator.h"
+
+#define LIVE_BLOCKS 64
+
+/* used by every thread */
+unsigned int ops_per_thread = 1000000;
+unsigned int max_block = 1024;
+
+/* set by a thread that finds a block that was overwritten */
+volatile int corrupted = 0;
+volatile long failed_allocations = 0;
+
+void* stress_routine(void* arg) {
+  unsigned int seed = (unsigned int)(long)arg;
+  char* blocks[LIVE_BLOCKS];
+  unsigned int sizes[LIVE_BLOCKS];
+  long failed = 0;
+  memset(blocks, 0, sizeof(blocks));
+
+  for (unsigned int i = 0; i < ops_per_thread; i++) {
+    int slot = rand_r(&seed) % LIVE_BLOCKS;
+    char fill = (char)slot;
+    if (blocks[slot] != NULL) {
+      /* check the first and last byte before we let go of it */
+      if (blocks[slot][0] != fill || blocks[slot][sizes[slot] - 1] != fill)
+        corrupted = 1;
+      my_free(blocks[slot]);
+      blocks[slot] = NULL;
+    }
+    else {
+      sizes[slot] = 1 + rand_r(&seed) % max_block;
+      blocks[slot] = (char*)my_malloc(sizes[slot]);
+      if (blocks[slot] == NULL) {
+        failed++;
+        continue;
+      }
+      memset(blocks[slot], fill, sizes[slot]);
+    }
+  }
+
+  for (int slot = 0; slot < LIVE_BLOCKS; slot++) {
+    if (blocks[slot] != NULL)
+      my_free(blocks[slot]);
+  }
+  __sync_fetch_and_add(&failed_allocations, failed);
+  return NULL;
+}
+
+double run_threads(int nthreads) {
+  pthread_t threads[nthreads];
+  struct timeval start, end;
+
+  gettimeofday(&start, 0);
+  for (long i = 0; i < nthreads; i++) {
+    if (pthread_create(&threads[i], NULL, stress_routine, (void*)(i + 1)) != 0) {
+      fprintf(stderr, "Error: pthread_create failed\n");
+      exit(1);
+    }
+  }
+  for (int i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+  gettimeofday(&end, 0);
+
+  return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1000000.0;
+}
+
+int main(int argc, char ** argv) {
+
+  unsigned int basic_block_size = 128;
+  unsigned int memory_length = 64 * 1024 * 1024;
+  int max_threads = 8;
+
+  int c;
+  while ((c = getopt(argc, argv, "hb:s:t:n:m:")) != -1) {
+    switch (c) {
+      case 'b':
+        basic_block_size = atoi(optarg);
+        break;
+      case 's':
+        memory_length = atoi(optarg);
+        break;
+      case 't':
+        max_threads = atoi(optarg);
+        break;
+      case 'n':
+        ops_per_thread = atoi(optarg);
+        break;
+      case 'm':
+        max_block = atoi(optarg);
+        break;
+      case 'h':
+        printf("usage: mtmemtest [-b <basic block size>] [-s <memory length>] [-t <max threads>]\n"
+               "                 [-n <operations per thread>] [-m <max block size>]\n"
+               "  defaults are 128 bytes, 64MB, 8 threads, 1000000 operations and 1024 bytes.\n");
+        return 0;
+      default:
+        fprintf(stderr, "Error: unknown flag(s), type -h for help\n");
+        return -1;
+    }
+  }
+
+  if (init_allocator_mt(basic_block_size, memory_length) == 0) {
+    fprintf(stderr, "Error: cannot initialize allocator with block size %u and length %u\n",
+            basic_block_size, memory_length);
+    return -1;
+  }
+
+  printf("threads   seconds   Mops/sec   speedup\n");
+  double base_rate = 0;
+  for (int nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+    double seconds = run_threads(nthreads);
+    double rate = (double)ops_per_thread * nthreads / seconds;
+    if (nthreads == 1)
+      base_rate = rate;
+    printf("%7d   %7.3f   %8.2f   %7.2f\n", nthreads, seconds, rate / 1e6, rate / base_rate);
+  }
+
+  /* with every block given back, the whole heap must be free again */
+  void* everything = my_malloc(memory_length / 2);
+  printf("failed allocations: %ld\n", failed_allocations);
+  release_allocator();
+
+  if (corrupted) {
+    printf("Memory checking error!\n");
+    return 1;
+  }
+  if (everything == NULL) {
+    printf("Heap did not coalesce back after all blocks were freed!\n");
+    return 1;
+  }
+  return 0;
+}
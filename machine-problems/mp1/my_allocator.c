@@ -1,4 +1,4 @@
-/* 
+/*
     File: my_allocator.c
 
     Author: Yinwei (Charlie) Zhang
@@ -6,7 +6,7 @@
             Texas A&M University
     Date  : 15.09.2014
 
-    Modified: 
+    Modified:
 
     This file contains the implementation of the module "MY_ALLOCATOR".
 
@@ -19,23 +19,29 @@
 
 /*  *Overview*
     *--------------------------------------------------------------------------*
-    This file implements my_allocator.  
+    This file implements my_allocator.
 
-    What my_allocator does is that it initally mallocs (creates) some specified memory size.
+    What my_allocator does is that it initally maps (creates) some specified memory size.
     Then you can "malloc", or get memory from that initial block of memory, via the my_malloc(..) method.
     Of course you can free the specified memory via my_free().  To free the original block, use
-    release_allocator(). 
+    release_allocator().
 
     Basically, after my_allocator is initiated, it functions like our own version of malloc and free.
 
+    The same allocator is also available as an object (struct Allocator): allocator_create() makes an
+    independent instance with its own memory, and allocator_malloc()/allocator_free() work against it.
+    init_allocator() and friends simply manage one default instance.
+
     *Details*
     *--------------------------------------------------------------------------*
-    We simplicity of calculation, we internally define our sizes to be in powers of 2.  
+    We simplicity of calculation, we internally define our sizes to be in powers of 2.
 
-    We have one big initial chunk of memory, defined by the user.  In order to know where each block of memory (split) is,
-    we add a header object before each chunk of memory.  So we take user defined size, calculate the number of headers required,
-    and allocate that size.  We also create a free list, which is an array of header pointers denote the size for each of the 
-    blocks, with the index being log_2(size).  
+    We have one big initial chunk of memory, defined by the user.  It is split into regions whose sizes are the
+    powers of 2 that add up to the length (largest first), so nothing is lost to rounding up the length.
+    Each region is a top-order block of its own and never coalesces with its neighbours.
+    In order to know where each block of memory (split) is,
+    we add a header object before each chunk of memory.  We also create a free list, which is an array of header
+    pointers, one list per block size, with the index being log_2(size) - log_2(basic block size).
 
 
 
@@ -43,9 +49,62 @@
     *--------------------------------------------------------------------------*
 
     For good management of our big block of memory from init_allocator(..), we use Knuth's buddy system method.
-    
 
+    A block of order k is 2^k bytes long and starts at an offset (from its region) that is a multiple of 2^k.
+    Its buddy is therefore found by flipping bit k of the offset: buddy = offset ^ (1 << k).
+
+    Every free list is doubly linked, so a buddy can be unlinked in O(1) when we coalesce.  Next to the
+    free lists we keep a bitmap (freeMask) with bit i set whenever free list i is non-empty.  Finding the
+    smallest non-empty list that can hold a request is then a single count-trailing-zeros instruction.
+    Sizes are turned into orders with count-leading-zeros, so no floating point math is involved.
+
+    Both my_malloc() and my_free() cost O(log N) in the worst case (one split or one coalesce per order),
+    and O(1) when a block of the right size is already free.
+
+    *Memory from the OS*
+    *--------------------------------------------------------------------------*
+
+    Memory is mapped with mmap(), not malloc().  An instance created with ALLOCATOR_GROWABLE maps a new
+    region whenever no free block is big enough, so it is not limited to its initial length.
+    ALLOCATOR_HUGEPAGES asks for transparent huge pages on big mappings, and ALLOCATOR_HUGETLB maps
+    explicit huge pages (falling back to normal pages if none are reserved).
+
+    When a whole region is free again (its top block is fully coalesced) it is marked idle, which
+    costs nothing but a timestamp.  Regions that stay idle longer than the release delay are handed
+    back to the OS with madvise(MADV_DONTNEED), keeping only the page with the header.  The release
+    is deferred: the instance remembers when the oldest idle region is due (nextReleaseMs), and the
+    first malloc or free after that time makes one pass over the regions.  allocator_trim() makes the
+    pass right away for every idle region.  The pass takes the due regions off the free list under
+    heapLock, calls madvise() with the lock dropped, and puts them back afterwards, so no other call
+    ever waits on the system call.  Resident memory therefore follows what is actually in use instead
+    of the high-water mark.
+
+    *Reset*
+    *--------------------------------------------------------------------------*
 
+    allocator_reset() frees every block at once, in O(regions).  Each instance has an epoch that is stamped
+    into every header it writes.  A reset bumps the epoch and puts every region back on the free
+    list as one block.  Headers left over from the previous epoch are never trusted again: a buddy
+    only counts as free if its epoch is current, and freeing a block from an old epoch is rejected.
+
+    *Statistics*
+    *--------------------------------------------------------------------------*
+
+    allocator_get_stats() fills in an AllocatorStats.  Heap-level numbers (free blocks per order, splits,
+    coalesces, the high-water mark) are kept under heapLock as a side effect of the buddy operations.
+    Per-call numbers (allocations, frees, bytes in use and requested) are kept in the thread cache of the
+    calling thread, so counting costs no shared cache line; the stats call adds them up.  Latency is only
+    measured for every n-th call (allocator_sample_latency()), and lands in a log2 histogram.
+
+    *Threads*
+    *--------------------------------------------------------------------------*
+
+    The ALLOCATOR_THREADED flag (init_allocator_mt() for the default instance) turns on the thread-safe
+    mode.  The buddy heap is then protected by heapLock, and each thread keeps a small cache of free
+    blocks for the lower orders (ThreadCache).  my_malloc() pops from the cache and my_free() pushes
+    onto it, without taking the lock.  An empty cache is refilled with CACHE_BATCH blocks in one trip
+    to the heap, and a full cache gives half of its blocks back in one trip.  Blocks sitting in a cache
+    are not free as far as the heap is concerned, so they are never coalesced until they are drained.
 
 */
 
@@ -59,67 +118,200 @@
 /* INCLUDES */
 /*--------------------------------------------------------------------------*/
 
-#include <stdlib.h> //NULL, malloc, realloc
-#include <string.h> //memcpy
-#include <stdio.h> //printf
-#include <math.h> //pow, log2, ceil
+#include <stdlib.h> //NULL, malloc, free
+#include <stdio.h> //fprintf, printf
+#include <string.h> //memset
 #include <stdbool.h> //for bools
 #include <assert.h> //for assert
+#include <pthread.h> //for the thread-safe mode
+#include <time.h> //clock_gettime, for idle regions
+#include <unistd.h> //sysconf
+#include <sys/mman.h> //mmap, madvise
 #include "my_allocator.h"
 
 /*--------------------------------------------------------------------------*/
-/* DATA STRUCTURES */ 
+/* DATA STRUCTURES */
 /*--------------------------------------------------------------------------*/
 
 
 /* HeaderNode
    ----------
- * This is what our free list points to.  It is used to implement
- * the buddy system, and the splitting and coalescing parts.  It also
- * keeps track of our available free memory.
+ * Every block, free or allocated, starts with a HeaderNode.  The user gets the
+ * memory right behind it.
+ *
+ * While a block is free, nextNode/prevNode link it into the free list of its order.
+ * The order, region, isFree and epoch fields are what my_free() uses to find and check the buddy.
+ * magic lets my_free() reject pointers that did not come from my_malloc().
+ *
+ * The struct is 32 bytes on 64-bit machines, which keeps user memory 16-byte aligned.
  *
- * The HeaderNodes are stored in our initially allocated memory, named Memory.
- * They are used to keep track of free space, so we will place them in not used
- * memory.
- * 
  * See Free List for more usage details.
  */
 typedef struct HeaderNode HeaderNode;
 struct HeaderNode{
-  Addr nextNode;
-  bool isRight;
-  int inheritance;
+  HeaderNode* nextNode;
+  HeaderNode* prevNode;
+  unsigned char order;    /* the block is 2^order bytes long, header included */
+  unsigned char isFree;
+  unsigned short region;  /* index of the region the block lives in */
+  unsigned int requested; /* the length the user asked for */
+  unsigned int epoch;     /* the epoch of the allocator when the header was written */
+  unsigned int magic;
 };
 
 /*--------------------------------------------------------------------------*/
 /* CONSTANTS */
 /*--------------------------------------------------------------------------*/
 
-static unsigned int FLBaseSize;
-static unsigned int FLMaxSize;
+#define HEADER_MAGIC 0xB0DD1E5u
+
+/* The free list can have at most one entry per bit of an unsigned int. */
+#define MAX_ORDERS 32
+
+/* Orders base .. base+CACHED_ORDERS-1 are cached per thread, bigger blocks always go to the heap. */
+#define CACHED_ORDERS 8
+#define CACHE_SLOTS 32
+#define CACHE_BATCH (CACHE_SLOTS / 2)
+
+/* marks a block that sits in a thread cache (HeaderNode.isFree) */
+#define IN_CACHE 2
+
+/* A region has to fit a header, and its index has to fit HeaderNode.region. */
+#define MAX_REGIONS 65535
+
+/* Grown regions are at least this big (unless the initial length was bigger). */
+#define MIN_GROW_ORDER 20
+
+/* Idle regions are released after this long, unless allocator_set_release_delay() says otherwise. */
+#define DEFAULT_RELEASE_DELAY_MS 1000
+
+/* A release pass hands back at most this many regions per trip without the lock. */
+#define RELEASE_BATCH 16
+
+#define HUGE_PAGE_SIZE (2ul << 20)
+
+/* Region
+   ------
+ * A top-order block, 2^order bytes at base.  Blocks never coalesce across regions.
+ * idle is set while the whole region is one free block; released once its pages went back to the OS.
+ */
+typedef struct Region Region;
+struct Region {
+  char* base;
+  unsigned int order;
+  bool idle;
+  bool released;
+  unsigned long idleSinceMs;
+};
+
+/* Mapping
+   -------
+ * One mmap() call, holding one or more regions.
+ */
+typedef struct Mapping Mapping;
+struct Mapping {
+  void* addr;
+  size_t length;
+};
+
+/* Counters
+   --------
+ * The per-call statistics.  Each thread cache has its own, so only one thread ever writes them.
+ * Bytes are signed, since a thread may free what another one allocated.
+ */
+typedef struct Counters Counters;
+struct Counters {
+  long allocations;
+  long frees;
+  long liveBlocks;
+  long bytesInUse;     /* whole blocks, headers and rounding included */
+  long bytesRequested; /* what the user asked for */
+};
+
+/* ThreadCache
+   -----------
+ * A per-thread stack of free blocks for each cached order.  epoch tells whether the blocks
+ * are still good; a cache left over from before allocator_reset() is simply forgotten.
+ * All caches of an instance are linked together, so they can be freed with it.
+ */
+typedef struct ThreadCache ThreadCache;
+struct ThreadCache {
+  Allocator* owner;
+  ThreadCache* nextCache;
+  ThreadCache* prevCache;
+  unsigned int epoch;
+  Counters counters;
+  unsigned int count[CACHED_ORDERS];
+  HeaderNode* blocks[CACHED_ORDERS][CACHE_SLOTS];
+};
 
-/* Free list
+/* Allocator
    ---------
+ * One independent buddy heap.
+ *
+ * Free list
+ * ---------
  * This free list keeps track of available memory spaces.  It a an array of HeaderNode pointers.
  * The index of the free list represents the size, with the space being 2^(index+base).
  * The base is derived from the user's basic block size, and the size of the free list is related
  * to the _length input.  Both the basic block size and overall length are rounded up to the next base 2
  * exponential for easy indexing.
-
- * Note the size is set with FLMaxSize, and the base is FLBaseSize.
- * Specifically the base size is the shift required to get the basic block size, 
+ *
+ * Note the biggest region order is flMaxSize, and the base is flBaseSize.
+ * Specifically the base size is the shift required to get the basic block size,
  * so if the bbs is 5, we would raise to 8, and set the shift to 3, since 2^3 = 8.
  * This reduces the size of our free list.
+ *
+ * freeMask has bit i set exactly when freeList[i] is non-empty.
+ *
+ * The regions are what we hand out.  The basic block size is raised to at least the size of a
+ * HeaderNode, since every block carries one.
  */
-static HeaderNode* (*FreeList)[]; //an array of Header node pointers
+struct Allocator {
+  unsigned int flBaseSize; //order of the basic block size
+  unsigned int flMaxSize;  //order of the biggest region
+  HeaderNode* freeList[MAX_ORDERS];
+  unsigned long freeMask;
+  unsigned int epoch;
+  int flags;
 
-/* Memory
-   --------------------
- * We'll give the user the allocated size.  Note that this can be _bad_ if
- * the user's basic block size is less than the size of our HeaderNodes,
- * since we use the memory to store the free HeaderNodes.
- */
-static Addr Memory;
+  Region* regions;
+  unsigned int nRegions;
+  Mapping* mappings;
+  unsigned int nMappings;
+  unsigned long totalSize;
+  unsigned long releaseDelayMs;
+  unsigned long nextReleaseMs; //when the oldest idle region is due, 0 if none is
+  bool releasing;              //a release pass is running
+
+  /* statistics, see allocator_get_stats() */
+  unsigned long freeCount[MAX_ORDERS];
+  unsigned long splits;
+  unsigned long coalesces;
+  unsigned long heapInUse; //bytes out of the heap, blocks in thread caches included
+  unsigned long highWater;
+  unsigned long failedAllocations;
+  Counters counters;       //calls without a thread cache, and caches of threads that exited
+  unsigned int sampleEvery;
+  unsigned long mallocLatency[ALLOCATOR_LATENCY_BUCKETS];
+  unsigned long freeLatency[ALLOCATOR_LATENCY_BUCKETS];
+
+  /* only used with ALLOCATOR_THREADED */
+  bool threadSafe;
+  pthread_mutex_t heapLock;
+  pthread_key_t cacheKey;
+  ThreadCache* caches;
+};
+
+/*--------------------------------------------------------------------------*/
+/* VARIABLES */
+/*--------------------------------------------------------------------------*/
+
+/* the instance behind init_allocator(), my_malloc() and my_free() */
+static Allocator* DefaultAllocator;
+
+/* counts calls towards the next latency sample */
+static __thread unsigned int SampleTick;
 
 /*--------------------------------------------------------------------------*/
 /* FORWARDS */
@@ -141,8 +333,9 @@ static Addr Memory;
  */
 unsigned int getIndex2(const unsigned int input)
 {
-    assert(input >= 0);
-    return (unsigned int)ceil(log2(input));
+    if (input <= 1)
+        return 0;
+    return 32 - __builtin_clz(input - 1);
 }
 
 
@@ -151,133 +344,840 @@ unsigned int getIndex2(const unsigned int input)
  */
 unsigned int roundUpPower2(const unsigned int input)
 {
-    return (unsigned int)pow(2, double(getIndex2(input)));
+    return 1u << getIndex2(input);
+}
+
+/*--------------------------------------------------------------------------*/
+/* HELPER FUNCTIONS FOR THE FREE LIST */
+/*--------------------------------------------------------------------------*/
+
+/* Pushes a free block onto the head of the free list of its order. */
+static void pushFreeNode(Allocator* a, HeaderNode* node, const unsigned int order)
+{
+    unsigned int index = order - a->flBaseSize;
+    HeaderNode* head = a->freeList[index];
+
+    node->order = order;
+    node->isFree = true;
+    node->epoch = a->epoch;
+    node->magic = HEADER_MAGIC;
+    node->prevNode = NULL;
+    node->nextNode = head;
+    if (head != NULL)
+        head->prevNode = node;
+    a->freeList[index] = node;
+    a->freeMask |= 1ul << index;
+    a->freeCount[index]++;
+}
+
+/* Unlinks a free block from anywhere in the free list of its order. */
+static void removeFreeNode(Allocator* a, HeaderNode* node)
+{
+    unsigned int index = node->order - a->flBaseSize;
+
+    if (node->prevNode != NULL)
+        node->prevNode->nextNode = node->nextNode;
+    else
+        a->freeList[index] = node->nextNode;
+    if (node->nextNode != NULL)
+        node->nextNode->prevNode = node->prevNode;
+    if (a->freeList[index] == NULL)
+        a->freeMask &= ~(1ul << index);
+    a->freeCount[index]--;
+    node->isFree = false;
+}
+
+/* Returns the buddy of a block of the given order, found by flipping bit 'order' of its offset. */
+static HeaderNode* getBuddy(Allocator* a, HeaderNode* node, const unsigned int order)
+{
+    char* base = a->regions[node->region].base;
+    unsigned long offset = (char*)node - base;
+    return (HeaderNode*)(base + (offset ^ (1ul << order)));
 }
 
-/* Note the currentIndex is the the shifted value
- * We need to guarantee that the currentFreeNode can fit the sizes... let's limit the bbs.
- *  
+/*--------------------------------------------------------------------------*/
+/* HELPER FUNCTIONS FOR REGIONS */
+/*--------------------------------------------------------------------------*/
+
+static unsigned long nowMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+}
+
+/* Hands the pages of an idle region back to the OS, except the one holding its header.
+ * The region stays mapped, and the pages come back (zeroed) when the region is used again.
  */
-void splitFreeList(HeaderNode* currentFreeNode, const unsigned int currentIndex) 
+static void releasePages(char* base, const unsigned int order)
 {
-    assert(currentIndex >= 1);
-    assert(currentFreeNode != NULL);
+    unsigned long pageSize = sysconf(_SC_PAGESIZE);
+    if ((1ul << order) > pageSize)
+        madvise(base + pageSize, (1ul << order) - pageSize, MADV_DONTNEED);
+}
 
-    //creating a new header node
-    unsigned int halfLength = (pow(2, (currentIndex+FLBaseSize))) / 2;
-    HeaderNode* newFreeNode = currentFreeNode + halfLength;
-    memcpy(((void*)newFreeNode), (void*)currentFreeNode, sizeof(currentFreeNode));
+/* Releases the regions that were idle for longer than the release delay.
+ * With _force, every idle region is released.  The caller must not hold heapLock.
+ *
+ * A due region is taken off the free list while its pages go back, so nobody can
+ * allocate from it while heapLock is dropped for madvise().  Only one pass runs at a time.
+ */
+static void releaseIdleRegions(Allocator* a, const bool _force)
+{
+    unsigned int batch[RELEASE_BATCH];
+    char* base[RELEASE_BATCH];
+    unsigned int order[RELEASE_BATCH];
 
-    //linking our header nodes to the free list
-    HeaderNode* freeListNode = (*FreeList)[currentIndex-1];
-    while(freeListNode != NULL) {
-        freeListNode = freeListNode->nextNode;
+    if (a->threadSafe)
+        pthread_mutex_lock(&a->heapLock);
+    if (a->releasing) {
+        if (a->threadSafe)
+            pthread_mutex_unlock(&a->heapLock);
+        return;
     }
-    if (freeListNode == NULL)
-        (*FreeList)[currentIndex-1] = currentFreeNode;
-        currentFreeNode->nextNode = newFreeNode;
+    a->releasing = true;
+    __atomic_store_n(&a->nextReleaseMs, 0, __ATOMIC_RELAXED);
+
+    unsigned long now = nowMs();
+    unsigned long next = 0;
+    unsigned int i = 0;
+    do {
+        unsigned int n = 0;
+        for (; i < a->nRegions && n < RELEASE_BATCH; i++) {
+            Region* r = &a->regions[i];
+            if (!r->idle || r->released)
+                continue;
+            if (!_force && now - r->idleSinceMs < a->releaseDelayMs) {
+                /* not yet, but remember when it is due */
+                unsigned long due = r->idleSinceMs + a->releaseDelayMs;
+                if (next == 0 || due < next)
+                    next = due;
+                continue;
+            }
+            removeFreeNode(a, (HeaderNode*)r->base);
+            batch[n] = i;
+            base[n] = r->base;
+            order[n] = r->order;
+            n++;
+        }
+        if (n == 0)
+            break;
+
+        if (a->threadSafe)
+            pthread_mutex_unlock(&a->heapLock);
+        for (unsigned int j = 0; j < n; j++)
+            releasePages(base[j], order[j]);
+        if (a->threadSafe)
+            pthread_mutex_lock(&a->heapLock);
+
+        for (unsigned int j = 0; j < n; j++) {
+            pushFreeNode(a, (HeaderNode*)base[j], order[j]);
+            a->regions[batch[j]].released = true;
+        }
+    } while (i < a->nRegions);
+
+    /* regions that went idle while the lock was dropped have scheduled themselves */
+    unsigned long scheduled = a->nextReleaseMs;
+    if (next != 0 && (scheduled == 0 || next < scheduled))
+        __atomic_store_n(&a->nextReleaseMs, next, __ATOMIC_RELAXED);
+    a->releasing = false;
+    if (a->threadSafe)
+        pthread_mutex_unlock(&a->heapLock);
+}
+
+/* Makes a release pass if an idle region is due.  Costs one load when none is waiting.
+ * The caller must not hold heapLock.
+ */
+static inline void releaseDueRegions(Allocator* a)
+{
+    unsigned long due = __atomic_load_n(&a->nextReleaseMs, __ATOMIC_RELAXED);
+    if (due != 0 && nowMs() >= due)
+        releaseIdleRegions(a, false);
+}
+
+/* Called whenever a block of the region's order goes on the free list.  The release
+ * itself is left to releaseDueRegions().
+ */
+static void markRegionIdle(Allocator* a, Region* r)
+{
+    r->idle = true;
+    r->idleSinceMs = nowMs();
+    if (a->nextReleaseMs == 0)
+        __atomic_store_n(&a->nextReleaseMs, r->idleSinceMs + a->releaseDelayMs, __ATOMIC_RELAXED);
+}
+
+/* Maps _length bytes (a multiple of the page size) for the instance. */
+static char* mapMemory(Allocator* a, size_t _length)
+{
+    int protection = PROT_READ | PROT_WRITE;
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    void* addr = MAP_FAILED;
+
+    if (a->nMappings % 16 == 0) {
+        Mapping* mappings = (Mapping*)realloc(a->mappings, (a->nMappings + 16) * sizeof(Mapping));
+        if (mappings == NULL)
+            return NULL;
+        a->mappings = mappings;
     }
-    else {
-        freeListNode->nextNode = currentFreeNode;
-        (currentFreeNode->nextNode) = newFreeNode;
+
+#ifdef MAP_HUGETLB
+    if ((a->flags & ALLOCATOR_HUGETLB) && _length >= HUGE_PAGE_SIZE) {
+        _length = (_length + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        addr = mmap(NULL, _length, protection, flags | MAP_HUGETLB, -1, 0);
+        /* no huge pages reserved, fall back to normal pages */
+    }
+#endif
+    if (addr == MAP_FAILED && (a->flags & ALLOCATOR_HUGEPAGES) && _length >= HUGE_PAGE_SIZE) {
+        /* over-map so the memory can start on a huge page boundary, then trim */
+        size_t padded = _length + HUGE_PAGE_SIZE;
+        char* raw = (char*)mmap(NULL, padded, protection, flags, -1, 0);
+        if (raw != MAP_FAILED) {
+            char* aligned = (char*)(((unsigned long)raw + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+            if (aligned > raw)
+                munmap(raw, aligned - raw);
+            if (aligned + _length < raw + padded)
+                munmap(aligned + _length, raw + padded - (aligned + _length));
+#ifdef MADV_HUGEPAGE
+            madvise(aligned, _length, MADV_HUGEPAGE);
+#endif
+            addr = aligned;
+        }
     }
-    //buddy system setup
+    if (addr == MAP_FAILED)
+        addr = mmap(NULL, _length, protection, flags, -1, 0);
+    if (addr == MAP_FAILED)
+        return NULL;
+
+    a->mappings[a->nMappings].addr = addr;
+    a->mappings[a->nMappings].length = _length;
+    a->nMappings++;
+    return (char*)addr;
 }
 
-/* This function goes through the free list, returning a BinaryNode* 
- * to the location.  If there exists no free list available, then it goes up
- * until it finds it, breaks it down into the required size via split().
- * Returns NULL if the free list is has no available space.
+/* Adds a region of the given order at base, and puts it on the free list as one block. */
+static bool addRegion(Allocator* a, char* base, const unsigned int order)
+{
+    if (a->nRegions == MAX_REGIONS)
+        return false;
+    if (a->nRegions % 16 == 0) {
+        Region* regions = (Region*)realloc(a->regions, (a->nRegions + 16) * sizeof(Region));
+        if (regions == NULL)
+            return false;
+        a->regions = regions;
+    }
+
+    Region* r = &a->regions[a->nRegions];
+    r->base = base;
+    r->order = order;
+    r->released = false;
+    markRegionIdle(a, r);
+
+    HeaderNode* node = (HeaderNode*)base;
+    node->region = a->nRegions++;
+    pushFreeNode(a, node, order);
+
+    a->totalSize += 1ul << order;
+    if (order > a->flMaxSize)
+        a->flMaxSize = order;
+    return true;
+}
+
+/* Maps one more region, big enough for a block of the given order. */
+static bool growHeap(Allocator* a, const unsigned int order)
+{
+    unsigned int growOrder = (order > a->flMaxSize) ? order : a->flMaxSize;
+    if (growOrder < MIN_GROW_ORDER)
+        growOrder = MIN_GROW_ORDER;
+    if (growOrder >= MAX_ORDERS)
+        return false;
+
+    char* base = mapMemory(a, 1ul << growOrder);
+    if (base == NULL)
+        return false;
+    if (!addRegion(a, base, growOrder)) {
+        a->nMappings--;
+        munmap(base, a->mappings[a->nMappings].length);
+        return false;
+    }
+    return true;
+}
+
+/* Puts every region back on the free list as one block. */
+static void resetFreeList(Allocator* a)
+{
+    for (unsigned int i = 0; i < MAX_ORDERS; i++) {
+        a->freeList[i] = NULL;
+        a->freeCount[i] = 0;
+    }
+    a->freeMask = 0;
+    a->heapInUse = 0;
+    for (unsigned int i = 0; i < a->nRegions; i++) {
+        Region* r = &a->regions[i];
+        HeaderNode* node = (HeaderNode*)r->base;
+        node->region = i;
+        pushFreeNode(a, node, r->order);
+        if (!r->idle)
+            markRegionIdle(a, r);
+    }
+}
+
+/* This function finds the smallest free block of at least the given order,
+ * splitting bigger blocks down to size when needed.  The block is removed from
+ * the free list.  Returns NULL if there is no block big enough.
  */
-HeaderNode* getFreeNode(const unsigned int index)
+static HeaderNode* getFreeNode(Allocator* a, const unsigned int order)
 {
-    int adjustedIndex = index - FLBaseSize;
-    HeaderNode* indexNode = (*FreeList)[adjustedIndex];
-    if(indexNode == NULL) {
-        for (int largerIndex = adjustedIndex; largerIndex <= FLMaxSize; largerIndex++) {
-            indexNode = (*FreeList)[largerIndex];
-            if (indexNode != NULL) {
-                unsigned int currentIndex = largerIndex;
-                while (currentIndex != adjustedIndex) {
-                    splitFreeList(indexNode, currentIndex);
-                    currentIndex -= 1;
-                    indexNode = (*FreeList)[currentIndex];
-                }
-                return indexNode;
-            }
-        } //went through free list, can't find any bigger blocks
-        return NULL;
+    unsigned int index = order - a->flBaseSize;
+    unsigned long candidates = a->freeMask & (~0ul << index);
+    if (candidates == 0) {
+        if (!(a->flags & ALLOCATOR_GROWABLE) || !growHeap(a, order))
+            return NULL;
+        candidates = a->freeMask & (~0ul << index);
+    }
+
+    unsigned int largerIndex = __builtin_ctzl(candidates);
+    HeaderNode* node = a->freeList[largerIndex];
+    removeFreeNode(a, node);
+
+    Region* r = &a->regions[node->region];
+    if (node->order == r->order) {
+        /* the region is in use again */
+        r->idle = false;
+        r->released = false;
     }
-    else return indexNode;
+
+    /* split down, putting the right halves on the free lists */
+    unsigned int currentOrder = largerIndex + a->flBaseSize;
+    while (currentOrder > order) {
+        currentOrder--;
+        HeaderNode* rightHalf = (HeaderNode*)((char*)node + (1ul << currentOrder));
+        rightHalf->region = node->region;
+        pushFreeNode(a, rightHalf, currentOrder);
+        a->splits++;
+    }
+    node->order = order;
+
+    a->heapInUse += 1ul << order;
+    if (a->heapInUse > a->highWater)
+        a->highWater = a->heapInUse;
+    return node;
 }
 
+/* Gives a block back to the heap, coalescing it with its buddy for as long as
+ * the buddy is a free block of the same order from the current epoch.
+ */
+static void freeToHeap(Allocator* a, HeaderNode* node)
+{
+    Region* r = &a->regions[node->region];
+    unsigned int order = node->order;
+    a->heapInUse -= 1ul << order;
+    while (order < r->order) {
+        HeaderNode* buddy = getBuddy(a, node, order);
+        if (buddy->isFree != true || buddy->order != order || buddy->epoch != a->epoch)
+            break;
+        removeFreeNode(a, buddy);
+        if (buddy < node)
+            node = buddy;
+        order++;
+        a->coalesces++;
+    }
+    pushFreeNode(a, node, order);
+    if (order == r->order)
+        markRegionIdle(a, r);
+}
 
 /*--------------------------------------------------------------------------*/
-/* HELPER FUNCTIONS FOR INIT_ALLOCATOR() */
+/* HELPER FUNCTIONS FOR STATISTICS */
+/*--------------------------------------------------------------------------*/
+
+/* Adds to a counter.  Shared counters may be written by several threads at once,
+ * the others only by their owner (but are read by allocator_get_stats()).
+ */
+static inline void addCounter(long* counter, const long value, const bool shared)
+{
+    if (shared)
+        __atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+static void addCounters(Counters* sum, Counters* c, const bool shared)
+{
+    addCounter(&sum->allocations, __atomic_load_n(&c->allocations, __ATOMIC_RELAXED), shared);
+    addCounter(&sum->frees, __atomic_load_n(&c->frees, __ATOMIC_RELAXED), shared);
+    addCounter(&sum->liveBlocks, __atomic_load_n(&c->liveBlocks, __ATOMIC_RELAXED), shared);
+    addCounter(&sum->bytesInUse, __atomic_load_n(&c->bytesInUse, __ATOMIC_RELAXED), shared);
+    addCounter(&sum->bytesRequested, __atomic_load_n(&c->bytesRequested, __ATOMIC_RELAXED), shared);
+}
+
+/* Counts one allocation (_sign = 1) or free (_sign = -1) of the block. */
+static void countBlock(Allocator* a, ThreadCache* cache, HeaderNode* node, const long _sign)
+{
+    Counters* c = (cache != NULL) ? &cache->counters : &a->counters;
+    bool shared = a->threadSafe && cache == NULL;
+
+    addCounter(_sign > 0 ? &c->allocations : &c->frees, 1, shared);
+    addCounter(&c->liveBlocks, _sign, shared);
+    addCounter(&c->bytesInUse, _sign * (1l << node->order), shared);
+    addCounter(&c->bytesRequested, _sign * (long)node->requested, shared);
+}
+
+static unsigned long nowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+/* Bucket i of a latency histogram counts calls that took [2^i, 2^(i+1)) nanoseconds. */
+static void recordLatency(unsigned long* histogram, const unsigned long _ns)
+{
+    unsigned int bucket = (_ns == 0) ? 0 : 63 - __builtin_clzl(_ns);
+    if (bucket >= ALLOCATOR_LATENCY_BUCKETS)
+        bucket = ALLOCATOR_LATENCY_BUCKETS - 1;
+    __atomic_fetch_add(&histogram[bucket], 1, __ATOMIC_RELAXED);
+}
+
+/* Returns the upper bound (in ns) of the bucket that holds the given fraction of the calls. */
+static unsigned long latencyPercentile(const unsigned long* histogram, const double _fraction)
+{
+    unsigned long total = 0, seen = 0;
+    for (unsigned int i = 0; i < ALLOCATOR_LATENCY_BUCKETS; i++)
+        total += histogram[i];
+    for (unsigned int i = 0; i < ALLOCATOR_LATENCY_BUCKETS; i++) {
+        seen += histogram[i];
+        if (total > 0 && seen >= _fraction * total)
+            return 2ul << i;
+    }
+    return 0;
+}
+
+/*--------------------------------------------------------------------------*/
+/* HELPER FUNCTIONS FOR THE THREAD CACHES */
 /*--------------------------------------------------------------------------*/
 
+/* Hands the blocks of the cache back to the heap.  Only 'keep' blocks per order stay cached.
+ * The caller must hold heapLock.
+ */
+static void drainCache(Allocator* a, ThreadCache* cache, const unsigned int keep)
+{
+    if (cache->epoch != a->epoch) {
+        /* left over from before a reset, the blocks are free already */
+        for (unsigned int i = 0; i < CACHED_ORDERS; i++)
+            cache->count[i] = 0;
+        cache->epoch = a->epoch;
+        return;
+    }
+    for (unsigned int i = 0; i < CACHED_ORDERS; i++) {
+        while (cache->count[i] > keep) {
+            HeaderNode* node = cache->blocks[i][--cache->count[i]];
+            node->isFree = false;
+            freeToHeap(a, node);
+        }
+    }
+}
+
+/* Called by pthreads when a thread exits, so its cached blocks are not lost. */
+static void releaseCache(void* arg)
+{
+    ThreadCache* cache = (ThreadCache*)arg;
+    Allocator* a = cache->owner;
+
+    pthread_mutex_lock(&a->heapLock);
+    drainCache(a, cache, 0);
+    addCounters(&a->counters, &cache->counters, true);
+    if (cache->prevCache != NULL)
+        cache->prevCache->nextCache = cache->nextCache;
+    else
+        a->caches = cache->nextCache;
+    if (cache->nextCache != NULL)
+        cache->nextCache->prevCache = cache->prevCache;
+    pthread_mutex_unlock(&a->heapLock);
+    free(cache);
+}
+
+/* Returns the cache of the calling thread, creating it on first use. */
+static ThreadCache* getCache(Allocator* a)
+{
+    ThreadCache* cache = (ThreadCache*)pthread_getspecific(a->cacheKey);
+    if (cache == NULL) {
+        cache = (ThreadCache*)calloc(1, sizeof(ThreadCache));
+        if (cache == NULL)
+            return NULL;
+        cache->owner = a;
+        pthread_mutex_lock(&a->heapLock);
+        cache->epoch = a->epoch;
+        cache->nextCache = a->caches;
+        if (a->caches != NULL)
+            a->caches->prevCache = cache;
+        a->caches = cache;
+        pthread_mutex_unlock(&a->heapLock);
+        pthread_setspecific(a->cacheKey, cache);
+    }
+    if (cache->epoch != a->epoch) {
+        /* left over from before a reset, the blocks are free already */
+        for (unsigned int i = 0; i < CACHED_ORDERS; i++)
+            cache->count[i] = 0;
+        cache->epoch = a->epoch;
+    }
+    return cache;
+}
+
+/* Allocation in thread-safe mode: from the cache if the order is cached, otherwise from the heap. */
+static HeaderNode* getNodeThreaded(Allocator* a, ThreadCache* cache, const unsigned int order)
+{
+    unsigned int index = order - a->flBaseSize;
+    HeaderNode* node;
+
+    if (cache == NULL || index >= CACHED_ORDERS) {
+        pthread_mutex_lock(&a->heapLock);
+        node = getFreeNode(a, order);
+        pthread_mutex_unlock(&a->heapLock);
+        return node;
+    }
+
+    if (cache->count[index] == 0) {
+        /* refill the cache in one trip to the heap */
+        pthread_mutex_lock(&a->heapLock);
+        while (cache->count[index] < CACHE_BATCH) {
+            node = getFreeNode(a, order);
+            if (node == NULL)
+                break;
+            node->isFree = IN_CACHE;
+            cache->blocks[index][cache->count[index]++] = node;
+        }
+        pthread_mutex_unlock(&a->heapLock);
+        if (cache->count[index] == 0)
+            return NULL;
+    }
+    node = cache->blocks[index][--cache->count[index]];
+    node->isFree = false;
+    return node;
+}
+
+/* Freeing in thread-safe mode: onto the cache if the order is cached, otherwise to the heap. */
+static void freeNodeThreaded(Allocator* a, ThreadCache* cache, HeaderNode* node)
+{
+    unsigned int index = node->order - a->flBaseSize;
+
+    if (cache == NULL || index >= CACHED_ORDERS) {
+        pthread_mutex_lock(&a->heapLock);
+        freeToHeap(a, node);
+        pthread_mutex_unlock(&a->heapLock);
+        return;
+    }
+
+    if (cache->count[index] == CACHE_SLOTS) {
+        /* give half of the cache back in one trip to the heap */
+        pthread_mutex_lock(&a->heapLock);
+        drainCache(a, cache, CACHE_BATCH);
+        pthread_mutex_unlock(&a->heapLock);
+    }
+    node->isFree = IN_CACHE;
+    cache->blocks[index][cache->count[index]++] = node;
+}
+
 /*--------------------------------------------------------------------------*/
-/* FUNCTIONS FOR MODULE MY_ALLOCATOR */
+/* FUNCTIONS FOR ALLOCATOR INSTANCES */
 /*--------------------------------------------------------------------------*/
 
-/* Don't forget to implement "init_allocator" and "release_allocator"! */
+Allocator* allocator_create(unsigned int _basic_block_size, unsigned int _length, int _flags) {
 
-/* This function initializes the memory allocator and makes a portion of 
-   ’_length’ bytes available. The allocator uses a ’_basic_block_size’ as 
-   its minimal unit of allocation. The function returns the amount of 
-   memory made available to the allocator. If an error occurred, 
-   it returns 0. 
-*/     
-unsigned int init_allocator(unsigned int _basic_block_size, unsigned int _length) {
+    if (_basic_block_size < sizeof(HeaderNode))
+        _basic_block_size = sizeof(HeaderNode);
+    if (_length < _basic_block_size || _length > (1u << (MAX_ORDERS - 1)))
+        return NULL;
 
-    assert(_basic_block_size >= 0 && _length >= 0);
-    assert(_basic_block_size <= _length);
+    Allocator* a = (Allocator*)calloc(1, sizeof(Allocator));
+    if (a == NULL)
+        return NULL;
 
     //setting constants
-    FLBaseSize = getIndex2(_basic_block_size);
-    FLMaxSize = getIndex2(_length) - FLBaseSize;
+    a->flBaseSize = getIndex2(_basic_block_size);
+    a->flags = _flags;
+    a->releaseDelayMs = DEFAULT_RELEASE_DELAY_MS;
+
+    //setting the memory: the length in whole basic blocks, split into power-of-2 regions, largest first
+    unsigned long pageSize = sysconf(_SC_PAGESIZE);
+    unsigned long length = roundUpPower2(_basic_block_size);
+    length = (_length + length - 1) & ~(length - 1);
+    char* memory = mapMemory(a, (length + pageSize - 1) & ~(pageSize - 1));
+    if (memory == NULL) {
+        free(a->mappings);
+        free(a);
+        return NULL;
+    }
+    unsigned long offset = 0;
+    for (int order = MAX_ORDERS - 1; order >= (int)a->flBaseSize; order--) {
+        if (length & (1ul << order)) {
+            addRegion(a, memory + offset, order);
+            offset += 1ul << order;
+        }
+    }
 
-    //setting the FreeList, memory
-    FreeList = (HeaderNode* (*)[])(malloc(FLMaxSize * sizeof(HeaderNode*)));
-    Memory = malloc(roundUpPower2(_length));
+    if (_flags & ALLOCATOR_THREADED) {
+        if (pthread_key_create(&a->cacheKey, releaseCache) != 0) {
+            allocator_destroy(a);
+            return NULL;
+        }
+        pthread_mutex_init(&a->heapLock, NULL);
+        a->threadSafe = true;
+    }
+    return a;
+}
+
+void allocator_destroy(Allocator* _a) {
+    if (_a == NULL)
+        return;
+    if (_a->threadSafe) {
+        /* the thread caches die with the instance; their blocks were in its regions anyway */
+        pthread_key_delete(_a->cacheKey);
+        while (_a->caches != NULL) {
+            ThreadCache* next = _a->caches->nextCache;
+            free(_a->caches);
+            _a->caches = next;
+        }
+        pthread_mutex_destroy(&_a->heapLock);
+    }
+    for (unsigned int i = 0; i < _a->nMappings; i++)
+        munmap(_a->mappings[i].addr, _a->mappings[i].length);
+    free(_a->mappings);
+    free(_a->regions);
+    free(_a);
+}
+
+unsigned long allocator_size(Allocator* _a) {
+    return _a->totalSize;
+}
 
-    //creating the initial header
-    (*FreeList)[FLMaxSize] = (HeaderNode*)Memory; 
-    (*FreeList)[FLMaxSize] -> nextNode = NULL;
-    (*FreeList)[FLMaxSize] -> isRight = false;
-    (*FreeList)[FLMaxSize] -> inheritance = -1;
-   
-    return roundUpPower2(_length);
+void allocator_set_release_delay(Allocator* _a, unsigned int _milliseconds) {
+    _a->releaseDelayMs = _milliseconds;
+    /* let the next call work out again when the idle regions are due */
+    if (__atomic_load_n(&_a->nextReleaseMs, __ATOMIC_RELAXED) != 0)
+        __atomic_store_n(&_a->nextReleaseMs, nowMs(), __ATOMIC_RELAXED);
+}
+
+void allocator_trim(Allocator* _a) {
+    releaseIdleRegions(_a, true);
+}
+
+void allocator_reset(Allocator* _a) {
+    if (_a->threadSafe)
+        pthread_mutex_lock(&_a->heapLock);
+    _a->epoch++;
+    resetFreeList(_a);
+
+    /* nothing is in use any more */
+    _a->counters.liveBlocks = _a->counters.bytesInUse = _a->counters.bytesRequested = 0;
+    for (ThreadCache* cache = _a->caches; cache != NULL; cache = cache->nextCache)
+        cache->counters.liveBlocks = cache->counters.bytesInUse = cache->counters.bytesRequested = 0;
+
+    if (_a->threadSafe)
+        pthread_mutex_unlock(&_a->heapLock);
+}
+
+static Addr allocateBlock(Allocator* _a, unsigned int _length) {
+    unsigned int order = getIndex2(_length + sizeof(HeaderNode));
+    if (order < _a->flBaseSize)
+        order = _a->flBaseSize;
+
+    ThreadCache* cache = NULL;
+    HeaderNode* node = NULL;
+    if (_length <= (1u << (MAX_ORDERS - 1)) - sizeof(HeaderNode)
+        && (order <= _a->flMaxSize || (_a->flags & ALLOCATOR_GROWABLE))) {
+        if (_a->threadSafe) {
+            cache = getCache(_a);
+            node = getNodeThreaded(_a, cache, order);
+        }
+        else
+            node = getFreeNode(_a, order);
+    }
+    if (node == NULL) {
+        __atomic_fetch_add(&_a->failedAllocations, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    node->requested = _length;
+    countBlock(_a, cache, node, 1);
+    releaseDueRegions(_a);
+    return (Addr)(node + 1);
+}
+
+static int freeBlock(Allocator* _a, Addr _p) {
+    HeaderNode* node = (HeaderNode*)_p - 1;
+    if (node->magic != HEADER_MAGIC || node->isFree || node->epoch != _a->epoch) {
+        fprintf(stderr, "allocator_free: %p is not an allocated block of this allocator\n", _p);
+        return -1;
+    }
+
+    if (_a->threadSafe) {
+        ThreadCache* cache = getCache(_a);
+        countBlock(_a, cache, node, -1);
+        freeNodeThreaded(_a, cache, node);
+    }
+    else {
+        countBlock(_a, NULL, node, -1);
+        freeToHeap(_a, node);
+    }
+    releaseDueRegions(_a);
+    return 0;
+}
+
+Addr allocator_malloc(Allocator* _a, unsigned int _length) {
+    if (_a == NULL)
+        return NULL;
+    if (_a->sampleEvery != 0 && ++SampleTick >= _a->sampleEvery) {
+        SampleTick = 0;
+        unsigned long start = nowNs();
+        Addr p = allocateBlock(_a, _length);
+        recordLatency(_a->mallocLatency, nowNs() - start);
+        return p;
+    }
+    return allocateBlock(_a, _length);
+}
+
+int allocator_free(Allocator* _a, Addr _p) {
+    if (_a == NULL || _p == NULL)
+        return -1;
+    if (_a->sampleEvery != 0 && ++SampleTick >= _a->sampleEvery) {
+        SampleTick = 0;
+        unsigned long start = nowNs();
+        int result = freeBlock(_a, _p);
+        recordLatency(_a->freeLatency, nowNs() - start);
+        return result;
+    }
+    return freeBlock(_a, _p);
+}
+
+/*--------------------------------------------------------------------------*/
+/* STATISTICS FOR ALLOCATOR INSTANCES */
+/*--------------------------------------------------------------------------*/
+
+void allocator_sample_latency(Allocator* _a, unsigned int _every) {
+    _a->sampleEvery = _every;
+}
+
+void allocator_get_stats(Allocator* _a, AllocatorStats* _stats) {
+    Counters sum;
+    memset(_stats, 0, sizeof(AllocatorStats));
+    memset(&sum, 0, sizeof(Counters));
+
+    if (_a->threadSafe)
+        pthread_mutex_lock(&_a->heapLock);
+
+    _stats->baseOrder = _a->flBaseSize;
+    _stats->maxOrder = _a->flMaxSize;
+    for (unsigned int i = 0; i + _a->flBaseSize <= _a->flMaxSize; i++)
+        _stats->freeBlocks[i] = _a->freeCount[i];
+    _stats->totalBytes = _a->totalSize;
+    _stats->regions = _a->nRegions;
+    for (unsigned int i = 0; i < _a->nRegions; i++) {
+        if (_a->regions[i].released)
+            _stats->releasedBytes += 1ul << _a->regions[i].order;
+    }
+    _stats->heapBytesInUse = _a->heapInUse;
+    _stats->highWater = _a->highWater;
+    _stats->splits = _a->splits;
+    _stats->coalesces = _a->coalesces;
+
+    addCounters(&sum, &_a->counters, false);
+    for (ThreadCache* cache = _a->caches; cache != NULL; cache = cache->nextCache)
+        addCounters(&sum, &cache->counters, false);
+
+    if (_a->threadSafe)
+        pthread_mutex_unlock(&_a->heapLock);
+
+    _stats->allocations = sum.allocations;
+    _stats->frees = sum.frees;
+    _stats->failedAllocations = __atomic_load_n(&_a->failedAllocations, __ATOMIC_RELAXED);
+    _stats->bytesInUse = sum.bytesInUse;
+    _stats->bytesRequested = sum.bytesRequested;
+    _stats->headerBytes = sum.liveBlocks * sizeof(HeaderNode);
+    _stats->internalFragmentation = sum.bytesInUse - sum.bytesRequested - _stats->headerBytes;
+    for (unsigned int i = 0; i < ALLOCATOR_LATENCY_BUCKETS; i++) {
+        _stats->mallocLatency[i] = __atomic_load_n(&_a->mallocLatency[i], __ATOMIC_RELAXED);
+        _stats->freeLatency[i] = __atomic_load_n(&_a->freeLatency[i], __ATOMIC_RELAXED);
+    }
+}
+
+void allocator_print_stats(Allocator* _a) {
+    AllocatorStats stats;
+    allocator_get_stats(_a, &stats);
+
+    printf("---- allocator statistics ----\n");
+    printf("memory        : %lu bytes in %u regions, %lu bytes released to the OS\n",
+           stats.totalBytes, stats.regions, stats.releasedBytes);
+    printf("in use        : %lu bytes (%lu requested, %lu headers, %lu lost to rounding)\n",
+           stats.bytesInUse, stats.bytesRequested, stats.headerBytes, stats.internalFragmentation);
+    printf("high water    : %lu bytes (%lu out of the heap now)\n", stats.highWater, stats.heapBytesInUse);
+    printf("calls         : %lu allocations, %lu frees, %lu failed allocations\n",
+           stats.allocations, stats.frees, stats.failedAllocations);
+    printf("buddy system  : %lu splits, %lu coalesces\n", stats.splits, stats.coalesces);
+    printf("free blocks   :");
+    for (unsigned int order = stats.baseOrder; order <= stats.maxOrder; order++)
+        printf(" [%lu]=%lu", 1ul << order, stats.freeBlocks[order - stats.baseOrder]);
+    printf("\n");
+    if (_a->sampleEvery != 0) {
+        printf("my_malloc ns  : p50 < %lu, p99 < %lu, p99.9 < %lu (1 in %u calls sampled)\n",
+               latencyPercentile(stats.mallocLatency, 0.5), latencyPercentile(stats.mallocLatency, 0.99),
+               latencyPercentile(stats.mallocLatency, 0.999), _a->sampleEvery);
+        printf("my_free ns    : p50 < %lu, p99 < %lu, p99.9 < %lu\n",
+               latencyPercentile(stats.freeLatency, 0.5), latencyPercentile(stats.freeLatency, 0.99),
+               latencyPercentile(stats.freeLatency, 0.999));
+    }
+}
+
+/*--------------------------------------------------------------------------*/
+/* FUNCTIONS FOR MODULE MY_ALLOCATOR */
+/*--------------------------------------------------------------------------*/
+
+/* This function initializes the memory allocator and makes a portion of
+   ’_length’ bytes available. The allocator uses a ’_basic_block_size’ as
+   its minimal unit of allocation. The function returns the amount of
+   memory made available to the allocator. If an error occurred,
+   it returns 0.
+*/
+unsigned int init_allocator(unsigned int _basic_block_size, unsigned int _length) {
+    release_allocator();
+    DefaultAllocator = allocator_create(_basic_block_size, _length, 0);
+    /* a new instance holds no more than its length, which fits */
+    return (DefaultAllocator != NULL) ? (unsigned int)allocator_size(DefaultAllocator) : 0;
+}
+
+unsigned int init_allocator_mt(unsigned int _basic_block_size, unsigned int _length) {
+    release_allocator();
+    DefaultAllocator = allocator_create(_basic_block_size, _length, ALLOCATOR_THREADED);
+    return (DefaultAllocator != NULL) ? (unsigned int)allocator_size(DefaultAllocator) : 0;
 }
 
 int release_allocator() {
-    // for (int i = 0; i < FLMaxSize; i++) {
-    //     if (FreeList[i] != NULL)
-    //         free FreeList[i];
-    // }
-    free(FreeList);
-    free(Memory);
+    allocator_destroy(DefaultAllocator);
+    DefaultAllocator = NULL;
     return 0;
-} 
+}
 
-extern Addr my_malloc(unsigned int _length) {
-    /* This preliminary implementation simply hands the call over the 
-       the C standard library! 
-       Of course this needs to be replaced by your implementation.
-    */
-    // assert (_length <= roundUpPower2(FLMaxSize+FLBaseSize));
-    // unsigned int index = getIndex2(_length);
-    // HeaderNode* freeNode = getFreeNode(index);
+void sample_allocator_latency(unsigned int _every) {
+    if (DefaultAllocator != NULL)
+        allocator_sample_latency(DefaultAllocator, _every);
+}
 
-    printf("HeaderNode size == %d\n", (int)sizeof(HeaderNode));
+int get_allocator_stats(AllocatorStats* _stats) {
+    if (DefaultAllocator == NULL)
+        return -1;
+    allocator_get_stats(DefaultAllocator, _stats);
+    return 0;
+}
 
+void print_allocator_stats() {
+    if (DefaultAllocator != NULL)
+        allocator_print_stats(DefaultAllocator);
+}
 
-    return malloc((size_t)_length);
+extern Addr my_malloc(unsigned int _length) {
+    return allocator_malloc(DefaultAllocator, _length);
 }
 
 extern int my_free(Addr _a) {
-    /* Same here! */
-    free(_a);
-    return 0;
+    return allocator_free(DefaultAllocator, _a);
 }
 
@@ -17,7 +17,15 @@
 /* DEFINES */
 /*--------------------------------------------------------------------------*/
 
-/* -- (none) -- */
+/* flags for 'allocator_create' */
+#define ALLOCATOR_THREADED  0x1  /* allocate and free from several threads */
+#define ALLOCATOR_GROWABLE  0x2  /* map more memory when the initial length runs out */
+#define ALLOCATOR_HUGEPAGES 0x4  /* ask for transparent huge pages on big mappings */
+#define ALLOCATOR_HUGETLB   0x8  /* map explicit huge pages, if the system has some reserved */
+
+/* sizes of the arrays in 'AllocatorStats' */
+#define ALLOCATOR_MAX_ORDERS 32
+#define ALLOCATOR_LATENCY_BUCKETS 32
 
 /*--------------------------------------------------------------------------*/
 /* INCLUDES */
@@ -29,7 +37,34 @@
 /*--------------------------------------------------------------------------*/
 
 typedef void * Addr;
- 
+
+typedef struct Allocator Allocator;
+/* An independent allocator instance, see "MODULE ALLOCATOR INSTANCES". */
+
+typedef struct AllocatorStats {
+  unsigned int  baseOrder;      /* the basic block size is 2^baseOrder */
+  unsigned int  maxOrder;       /* the biggest block is 2^maxOrder */
+  unsigned long freeBlocks[ALLOCATOR_MAX_ORDERS];
+                                /* free blocks of size 2^(baseOrder+i) */
+  unsigned long totalBytes;     /* memory made available */
+  unsigned int  regions;        /* top-order blocks the memory is made of */
+  unsigned long releasedBytes;  /* entirely free memory given back to the OS */
+  unsigned long bytesInUse;     /* in allocated blocks */
+  unsigned long bytesRequested; /* what was asked for, out of bytesInUse */
+  unsigned long headerBytes;    /* block headers, out of bytesInUse */
+  unsigned long internalFragmentation;
+                                /* lost to power-of-2 rounding, out of bytesInUse */
+  unsigned long heapBytesInUse; /* out of the heap, blocks in thread caches included */
+  unsigned long highWater;      /* the most heapBytesInUse ever was */
+  unsigned long allocations;
+  unsigned long frees;
+  unsigned long failedAllocations;
+  unsigned long splits;
+  unsigned long coalesces;
+  unsigned long mallocLatency[ALLOCATOR_LATENCY_BUCKETS];
+  unsigned long freeLatency[ALLOCATOR_LATENCY_BUCKETS];
+                                /* sampled calls that took [2^i, 2^(i+1)) ns */
+} AllocatorStats;
 
 /*--------------------------------------------------------------------------*/
 /* FORWARDS */ 
@@ -50,7 +85,14 @@ unsigned int init_allocator(unsigned int _basic_block_size,
    it returns 0. 
 */ 
 
-int release_allocator(); 
+unsigned int init_allocator_mt(unsigned int _basic_block_size,
+			       unsigned int _length);
+/* Same as 'init_allocator', but 'my_malloc' and 'my_free' may then be
+   called from several threads at once. Each thread keeps a small cache
+   of free blocks, so most calls do not take the allocator lock.
+*/
+
+int release_allocator();
 /* This function returns any allocated memory to the operating system. 
    After this function is called, any allocation fails.
 */ 
@@ -63,4 +105,69 @@ int my_free(Addr _a);
 /* Frees the section of physical memory previously allocated 
    using ’my_malloc’. Returns 0 if everything ok. */ 
 
-#endif 
+int get_allocator_stats(AllocatorStats * _stats);
+/* Fills in the statistics of the allocator. Returns 0 if everything ok. */
+
+void print_allocator_stats();
+/* Prints the statistics of the allocator to stdout. */
+
+void sample_allocator_latency(unsigned int _every);
+/* Measures the latency of every '_every'-th call to 'my_malloc' and
+   'my_free' (0, the default, turns sampling off). */
+
+/*--------------------------------------------------------------------------*/
+/* MODULE   ALLOCATOR INSTANCES */
+/*--------------------------------------------------------------------------*/
+
+/* The functions above work on one process-wide allocator. The functions
+   below do the same for any number of independent instances, each with its
+   own memory, basic block size and length.
+*/
+
+Allocator * allocator_create(unsigned int _basic_block_size,
+                             unsigned int _length, int _flags);
+/* Creates an allocator that makes a portion of '_length' bytes available,
+   in units of '_basic_block_size'. '_flags' is 0 or any of the ALLOCATOR_*
+   flags. Returns 0 if an error occurred. */
+
+void allocator_destroy(Allocator * _a);
+/* Returns all memory of the instance to the operating system. Every block
+   allocated from it becomes invalid. */
+
+unsigned long allocator_size(Allocator * _a);
+/* Returns the amount of memory made available by the instance. This
+   includes memory mapped since by a growable instance, which can be more
+   than an unsigned int holds. */
+
+void allocator_set_release_delay(Allocator * _a, unsigned int _milliseconds);
+/* Memory that is entirely free for longer than this is given back to the
+   operating system (it stays reserved, and comes back when needed) by the
+   first 'allocator_malloc' or 'allocator_free' after that time.
+   The default is one second. */
+
+void allocator_trim(Allocator * _a);
+/* Gives all entirely free memory back to the operating system now. */
+
+Addr allocator_malloc(Allocator * _a, unsigned int _length);
+/* Same as 'my_malloc', against the given instance. */
+
+int allocator_free(Allocator * _a, Addr _p);
+/* Same as 'my_free', against the given instance. */
+
+void allocator_get_stats(Allocator * _a, AllocatorStats * _stats);
+void allocator_print_stats(Allocator * _a);
+void allocator_sample_latency(Allocator * _a, unsigned int _every);
+/* Same as 'get_allocator_stats', 'print_allocator_stats' and
+   'sample_allocator_latency', for the given instance. Statistics are
+   cheap to keep; reading them while other threads allocate gives a
+   consistent heap but slightly stale per-thread counts. */
+
+void allocator_reset(Allocator * _a);
+/* Frees every block of the instance at once. No block is visited; the cost
+   is one step per region, which is a handful unless a growable instance has
+   mapped many. This is meant for arenas that are thrown away after a
+   request or a connection.
+   Blocks allocated before the reset must not be used or freed afterwards,
+   and no other thread may use the instance during the reset. */
+
+#endif